@@ -2,10 +2,30 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
 #include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <map>
+#include <cstdint>
+#include <cstdlib>
+#include <zlib.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
 
 const int BOARD_SIZE = 3;
 const int MAX_TOKENS = BOARD_SIZE;
 const int CELL_SIZE = 100;  // Size of each cell in pixels
+const char* const BOOK_FILE = "opening_book.bin";  // Written by --build-book, loaded at startup
 
 // Structure to hold game state
 struct GameState {
@@ -14,6 +34,20 @@ struct GameState {
     char currentPlayer;
 };
 
+// Multi-PV analysis (see analysisWorker)
+const int MAX_ROOT_MOVES = MAX_TOKENS * 2;
+const int MAX_ANALYSIS_DEPTH = 64;
+const int WIN_SCORE = 10000;
+
+// Search result for one root move
+struct MoveAnalysis {
+    int move[4];
+    int score;                         // From the point of view of the player to move
+    int depth;                         // Depth of the last finished search, 0 = not searched yet
+    int pv[MAX_ANALYSIS_DEPTH][4];     // Principal variation starting with move, -1s for a pass
+    int pvLength;
+};
+
 // Simple stack implementation
 const int MAX_STACK_SIZE = 100;
 GameState stateStack[MAX_STACK_SIZE];
@@ -42,20 +76,34 @@ GameState currentState;
 // Function declarations
 void initializeGame();
 bool hasWon(char player);
+bool hasWon(const GameState& state, char player);
 bool isPositionEmpty(int row, int col);
+bool isPositionEmpty(const GameState& state, int row, int col);
 bool isOnBoard(int row, int col);
 void getAllPossibleMoves(int moves[][4], int* moveCount);
+void getAllPossibleMoves(const GameState& state, int moves[][4], int* moveCount);
 void applyMove(int move[4]);
+void applyMove(GameState& state, int move[4]);
 char getOpponent(char player);
 char evaluateGameState();
 bool findBestMove(int bestMove[4]);
 int findTokenAtPosition(int row, int col);
 bool getValidMoveFromPosition(int row, int col, int move[4]);
 bool hasValidMoves(char player);  // NEW FUNCTION to check if a player has valid moves
+bool runSolver(const std::string& dir, int threadCount);
+void updateAnalysis(const GameState& state);
+void stopAnalysis();
+int getAnalysisSnapshot(MoveAnalysis entries[], int* depth, bool* complete);
+std::string formatScore(int score);
+bool buildBook(const std::string& path, int plies, int threadCount);
+bool loadBook(const std::string& path);
+bool probeBook(const GameState& state, int move[4]);
+void printBookHitRate();
 
 // Draw the game board using SFML
 void drawBoard(sf::RenderWindow& window, sf::Sprite playerA_sprites[], sf::Sprite playerB_sprites[],
-    sf::Font& font, const std::string& message, sf::RectangleShape& restartButton, sf::Text& restartText) {
+    sf::Font& font, const std::string& message, sf::RectangleShape& restartButton, sf::Text& restartText,
+    bool showAnalysis, sf::RectangleShape& analyzeButton, sf::Text& analyzeText) {
     // Clear previous frame
     window.clear(sf::Color::Black);
 
@@ -114,6 +162,69 @@ void drawBoard(sf::RenderWindow& window, sf::Sprite playerA_sprites[], sf::Sprit
         }
     }
 
+    // Draw the analysis overlay: each movable token's cell is tinted by the value of moving it
+    if (showAnalysis) {
+        MoveAnalysis entries[MAX_ROOT_MOVES];
+        int depth = 0;
+        bool complete = false;
+        int entryCount = getAnalysisSnapshot(entries, &depth, &complete);
+        int best = -1;
+
+        for (int i = 0; i < entryCount; i++) {
+            if (entries[i].depth == 0) continue;  // Not searched yet
+            if (best == -1 || entries[i].score > entries[best].score) best = i;
+
+            // Green = good for the player to move, red = bad; forced results are fully saturated
+            int score = entries[i].score;
+            int strength = std::min(std::abs(score) * 40, 255);
+            if (std::abs(score) > WIN_SCORE - MAX_ANALYSIS_DEPTH) strength = 255;
+            sf::Color tint = (score >= 0) ? sf::Color(0, 255, 0, strength / 2) : sf::Color(255, 0, 0, strength / 2);
+
+            sf::RectangleShape overlay(sf::Vector2f(CELL_SIZE - 2, CELL_SIZE - 2));
+            overlay.setPosition(entries[i].move[1] * CELL_SIZE, entries[i].move[0] * CELL_SIZE);
+            overlay.setFillColor(tint);
+            window.draw(overlay);
+
+            sf::Text scoreText;
+            scoreText.setFont(font);
+            scoreText.setCharacterSize(16);
+            scoreText.setFillColor(sf::Color::Black);
+            scoreText.setString(formatScore(score));
+            scoreText.setPosition(entries[i].move[1] * CELL_SIZE + 4, entries[i].move[0] * CELL_SIZE + 2);
+            window.draw(scoreText);
+        }
+
+        // Summary of the best line so far, on its own row below the buttons
+        sf::Text statusText;
+        statusText.setFont(font);
+        statusText.setCharacterSize(12);
+        statusText.setFillColor(sf::Color::Yellow);
+        statusText.setPosition(10, (BOARD_SIZE + 2) * CELL_SIZE + 100);
+
+        std::string status = "Depth " + std::to_string(depth) + (complete ? " (solved)" : "");
+        if (best != -1) {
+            status += "  best " + formatScore(entries[best].score) + ":";
+            for (int m = 0; m < entries[best].pvLength; m++) {
+                std::string step;
+                if (entries[best].pv[m][0] == -1) {
+                    step = " pass";
+                }
+                else {
+                    step = " (" + std::to_string(entries[best].pv[m][0]) + "," + std::to_string(entries[best].pv[m][1]) +
+                        ")>(" + std::to_string(entries[best].pv[m][2]) + "," + std::to_string(entries[best].pv[m][3]) + ")";
+                }
+
+                // Stop before the line runs past the right edge of the window
+                statusText.setString(status + step);
+                if (statusText.getLocalBounds().width > (BOARD_SIZE + 2) * CELL_SIZE - 20) break;
+                status += step;
+            }
+        }
+
+        statusText.setString(status);
+        window.draw(statusText);
+    }
+
     // Display current player turn indicator
     sf::Text turnText;
     turnText.setFont(font);
@@ -143,13 +254,39 @@ void drawBoard(sf::RenderWindow& window, sf::Sprite playerA_sprites[], sf::Sprit
     // Draw restart button
     window.draw(restartButton);
     window.draw(restartText);
+
+    // Draw analysis toggle button
+    window.draw(analyzeButton);
+    window.draw(analyzeText);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Offline solver mode: GameLogic --solve <dir> [threads]
+    if (argc >= 3 && std::string(argv[1]) == "--solve") {
+        int threadCount = (argc >= 4) ? std::atoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+        return runSolver(argv[2], threadCount) ? 0 : 1;
+    }
+
+    // Offline opening book builder: GameLogic --build-book [plies] [threads]
+    if (argc >= 2 && std::string(argv[1]) == "--build-book") {
+        int plies = (argc >= 3) ? std::atoi(argv[2]) : 8;
+        int threadCount = (argc >= 4) ? std::atoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+        if (plies < 1) {
+            // Don't overwrite an existing book with an empty one
+            std::cerr << "Usage: " << argv[0] << " --build-book [plies] [threads]  (plies must be at least 1)\n";
+            return 1;
+        }
+        return buildBook(BOOK_FILE, plies, threadCount) ? 0 : 1;
+    }
+
+    if (loadBook(BOOK_FILE)) {
+        std::cout << "Opening book loaded.\n";
+    }
+
     initializeGame();
 
-    // Create window with additional height for the restart button
-    sf::RenderWindow window(sf::VideoMode((BOARD_SIZE + 2) * CELL_SIZE, (BOARD_SIZE + 2) * CELL_SIZE + 100),
+    // Create window with additional height for the buttons and the analysis line
+    sf::RenderWindow window(sf::VideoMode((BOARD_SIZE + 2) * CELL_SIZE, (BOARD_SIZE + 2) * CELL_SIZE + 125),
         "Token Movement Game", sf::Style::Close);
 
     // Load font
@@ -238,6 +375,24 @@ int main() {
         restartButton.getPosition().y + (restartButton.getSize().y - textBounds.height) / 2 - 5
     );
 
+    // Create analysis toggle button to the left of the restart button
+    sf::RectangleShape analyzeButton(sf::Vector2f(120, 30));
+    analyzeButton.setFillColor(sf::Color(128, 128, 128));  // grey button
+    analyzeButton.setPosition(restartButton.getPosition().x - 130, restartButton.getPosition().y);
+
+    sf::Text analyzeText;
+    analyzeText.setFont(font);
+    analyzeText.setString("Analyze");
+    analyzeText.setCharacterSize(18);
+    analyzeText.setFillColor(sf::Color::White);
+
+    textBounds = analyzeText.getLocalBounds();
+    analyzeText.setPosition(
+        analyzeButton.getPosition().x + (analyzeButton.getSize().x - textBounds.width) / 2,
+        analyzeButton.getPosition().y + (analyzeButton.getSize().y - textBounds.height) / 2 - 5
+    );
+    bool analysisEnabled = false;
+
     std::string message = "Click on a token to move it. Player A moves right, Player B moves down.";
     bool waitForComputerMove = false;
     sf::Clock clock;
@@ -265,6 +420,14 @@ int main() {
                     waitForComputerMove = false;
                     gameOver = false;
                 }
+                // Toggle the live analysis overlay
+                else if (analyzeButton.getGlobalBounds().contains(mousePos)) {
+                    analysisEnabled = !analysisEnabled;
+                    analyzeButton.setFillColor(analysisEnabled ? sf::Color(80, 140, 80) : sf::Color(128, 128, 128));
+                    if (!analysisEnabled) {
+                        stopAnalysis();
+                    }
+                }
                 // Process game moves only if not game over and it's player's turn
                 else if (!gameOver && currentState.currentPlayer == 'A') {
                     // Check if Player A has valid moves
@@ -324,6 +487,7 @@ int main() {
                         ") to (" + std::to_string(computerMove[2]) + "," + std::to_string(computerMove[3]) + ")";
 
                     applyMove(computerMove);
+                    printBookHitRate();
                 }
                 else {
                     std::cout << "Computer has no valid moves. Turn passes.\n";
@@ -344,8 +508,17 @@ int main() {
             gameOver = true;
         }
 
+        // Restart the analysis whenever the position changes
+        if (analysisEnabled && !gameOver) {
+            updateAnalysis(currentState);
+        }
+        else if (analysisEnabled && gameOver) {
+            stopAnalysis();
+        }
+
         // Draw game state
-        drawBoard(window, playerA_sprites, playerB_sprites, font, message, restartButton, restartText);
+        drawBoard(window, playerA_sprites, playerB_sprites, font, message, restartButton, restartText,
+            analysisEnabled && !gameOver, analyzeButton, analyzeText);
 
         // Display everything
         window.display();
@@ -354,6 +527,7 @@ int main() {
         sf::sleep(sf::milliseconds(50));
     }
 
+    stopAnalysis();
     return 0;
 }
 
@@ -395,27 +569,35 @@ void initializeGame() {
 }
 
 bool hasWon(char player) {
+    return hasWon(currentState, player);
+}
+
+bool hasWon(const GameState& state, char player) {
     if (player == 'A') {
         // Check if all Player A tokens are off the right edge
         for (int i = 0; i < MAX_TOKENS; i++) {
-            if (currentState.playerA_tokens[i][1] <= BOARD_SIZE) return false;
+            if (state.playerA_tokens[i][1] <= BOARD_SIZE) return false;
         }
         return true;
     }
     else {
         // Check if all Player B tokens are off the bottom edge
         for (int j = 0; j < MAX_TOKENS; j++) {
-            if (currentState.playerB_tokens[j][0] <= BOARD_SIZE) return false;
+            if (state.playerB_tokens[j][0] <= BOARD_SIZE) return false;
         }
         return true;
     }
 }
 
 bool isPositionEmpty(int row, int col) {
+    return isPositionEmpty(currentState, row, col);
+}
+
+bool isPositionEmpty(const GameState& state, int row, int col) {
     // Check if position is occupied by any token
     for (int i = 0; i < MAX_TOKENS; i++) {
-        if (currentState.playerA_tokens[i][0] == row && currentState.playerA_tokens[i][1] == col) return false;
-        if (currentState.playerB_tokens[i][0] == row && currentState.playerB_tokens[i][1] == col) return false;
+        if (state.playerA_tokens[i][0] == row && state.playerA_tokens[i][1] == col) return false;
+        if (state.playerB_tokens[i][0] == row && state.playerB_tokens[i][1] == col) return false;
     }
     return true;
 }
@@ -527,19 +709,23 @@ bool getValidMoveFromPosition(int row, int col, int move[4]) {
 }
 
 void getAllPossibleMoves(int moves[][4], int* moveCount) {
+    getAllPossibleMoves(currentState, moves, moveCount);
+}
+
+void getAllPossibleMoves(const GameState& state, int moves[][4], int* moveCount) {
     *moveCount = 0;
 
-    if (currentState.currentPlayer == 'A') {
+    if (state.currentPlayer == 'A') {
         // Player A moves right (horizontal)
         for (int i = 0; i < MAX_TOKENS; i++) {
-            int fromRow = currentState.playerA_tokens[i][0];
-            int fromCol = currentState.playerA_tokens[i][1];
+            int fromRow = state.playerA_tokens[i][0];
+            int fromCol = state.playerA_tokens[i][1];
 
             // Check 1-step move to the right
             int toRow = fromRow;
             int toCol = fromCol + 1;
             if (isOnBoard(toRow, toCol)) {
-                if (isPositionEmpty(toRow, toCol)) {
+                if (isPositionEmpty(state, toRow, toCol)) {
                     moves[*moveCount][0] = fromRow;
                     moves[*moveCount][1] = fromCol;
                     moves[*moveCount][2] = toRow;
@@ -552,12 +738,12 @@ void getAllPossibleMoves(int moves[][4], int* moveCount) {
                     if (isOnBoard(toRow, toCol)) {
                         bool opponentBetween = false;
                         for (int j = 0; j < MAX_TOKENS; j++) {
-                            if (currentState.playerB_tokens[j][0] == fromRow && currentState.playerB_tokens[j][1] == fromCol + 1) {
+                            if (state.playerB_tokens[j][0] == fromRow && state.playerB_tokens[j][1] == fromCol + 1) {
                                 opponentBetween = true;
                                 break;
                             }
                         }
-                        if (opponentBetween && isPositionEmpty(toRow, toCol)) {
+                        if (opponentBetween && isPositionEmpty(state, toRow, toCol)) {
                             moves[*moveCount][0] = fromRow;
                             moves[*moveCount][1] = fromCol;
                             moves[*moveCount][2] = toRow;
@@ -572,14 +758,14 @@ void getAllPossibleMoves(int moves[][4], int* moveCount) {
     else {
         // Player B moves down (vertical)
         for (int j = 0; j < MAX_TOKENS; j++) {
-            int fromRow = currentState.playerB_tokens[j][0];
-            int fromCol = currentState.playerB_tokens[j][1];
+            int fromRow = state.playerB_tokens[j][0];
+            int fromCol = state.playerB_tokens[j][1];
 
             // Check 1-step move down
             int toRow = fromRow + 1;
             int toCol = fromCol;
             if (isOnBoard(toRow, toCol)) {
-                if (isPositionEmpty(toRow, toCol)) {
+                if (isPositionEmpty(state, toRow, toCol)) {
                     moves[*moveCount][0] = fromRow;
                     moves[*moveCount][1] = fromCol;
                     moves[*moveCount][2] = toRow;
@@ -592,12 +778,12 @@ void getAllPossibleMoves(int moves[][4], int* moveCount) {
                     if (isOnBoard(toRow, toCol)) {
                         bool opponentBetween = false;
                         for (int i = 0; i < MAX_TOKENS; i++) {
-                            if (currentState.playerA_tokens[i][0] == fromRow + 1 && currentState.playerA_tokens[i][1] == fromCol) {
+                            if (state.playerA_tokens[i][0] == fromRow + 1 && state.playerA_tokens[i][1] == fromCol) {
                                 opponentBetween = true;
                                 break;
                             }
                         }
-                        if (opponentBetween && isPositionEmpty(toRow, toCol)) {
+                        if (opponentBetween && isPositionEmpty(state, toRow, toCol)) {
                             moves[*moveCount][0] = fromRow;
                             moves[*moveCount][1] = fromCol;
                             moves[*moveCount][2] = toRow;
@@ -612,12 +798,16 @@ void getAllPossibleMoves(int moves[][4], int* moveCount) {
 }
 
 void applyMove(int move[4]) {
-    if (currentState.currentPlayer == 'A') {
+    applyMove(currentState, move);
+}
+
+void applyMove(GameState& state, int move[4]) {
+    if (state.currentPlayer == 'A') {
         // Update Player A token position
         for (int i = 0; i < MAX_TOKENS; i++) {
-            if (currentState.playerA_tokens[i][0] == move[0] && currentState.playerA_tokens[i][1] == move[1]) {
-                currentState.playerA_tokens[i][0] = move[2];
-                currentState.playerA_tokens[i][1] = move[3];
+            if (state.playerA_tokens[i][0] == move[0] && state.playerA_tokens[i][1] == move[1]) {
+                state.playerA_tokens[i][0] = move[2];
+                state.playerA_tokens[i][1] = move[3];
                 break;
             }
         }
@@ -625,9 +815,9 @@ void applyMove(int move[4]) {
     else {
         // Update Player B token position
         for (int j = 0; j < MAX_TOKENS; j++) {
-            if (currentState.playerB_tokens[j][0] == move[0] && currentState.playerB_tokens[j][1] == move[1]) {
-                currentState.playerB_tokens[j][0] = move[2];
-                currentState.playerB_tokens[j][1] = move[3];
+            if (state.playerB_tokens[j][0] == move[0] && state.playerB_tokens[j][1] == move[1]) {
+                state.playerB_tokens[j][0] = move[2];
+                state.playerB_tokens[j][1] = move[3];
                 break;
             }
         }
@@ -692,6 +882,9 @@ bool findBestMove(int bestMove[4]) {
 
     if (moveCount == 0) return false;
 
+    // Opening positions have a precomputed reply
+    if (probeBook(currentState, bestMove)) return true;
+
     // Save current state
     GameState savedState = currentState;
     pushState(savedState);
@@ -722,4 +915,947 @@ bool findBestMove(int bestMove[4]) {
     }
     currentState = popState();
     return true;
+}
+
+// ---------------------------------------------------------------------------
+// Out-of-core retrograde solver
+//
+// Positions are split into partitions by which tokens have already reached
+// their goal edge (one bit per token for each player). A token in its goal
+// never moves again and never blocks anyone, so a partition only depends on
+// the partitions with exactly one more token home.
+//
+// Inside a partition every remaining token is one digit 0..BOARD_SIZE (its
+// column for player A, its row for player B) and every move raises a digit.
+// Each partition is cut again into slices: the lowest sliceDigits() digits
+// vary inside a slice and the remaining top digits name it. Within a slice a
+// descending sweep always finds same-slice successors solved; moves that
+// raise a top digit land in a slice with a larger digit sum, and moves that
+// bring a token home land in exactly one slice of a partition with one more
+// token home. So all slices with the same goal count and the same top digit
+// sum are independent and are shared between worker threads, one wave at a
+// time.
+//
+// Every finished slice is written as zlib-compressed chunks to
+// <dir>/p_<maskA>_<maskB>_<slice>.bin, so an interrupted run resumes from the
+// last finished slice. Files are flushed to disk before they get their final
+// name, and files that fail to decompress or belong to another board are
+// solved again. While a slice is swept only that slice and the (at most
+// 2 * top digits + tokens left) slices it depends on are in memory, so peak
+// memory is about threads * (1 + 3 * 2 * BOARD_SIZE) slices of at most
+// SOLVE_SLICE_LIMIT bytes.
+// ---------------------------------------------------------------------------
+
+// Results stored per position: bits 0-1 with A to move, bits 2-3 with B to move
+const unsigned char SOLVE_INVALID = 0;  // Two tokens on the same cell
+const unsigned char SOLVE_A_WINS = 1;
+const unsigned char SOLVE_B_WINS = 2;
+const unsigned char SOLVE_DRAW = 3;     // Neither player can ever move again
+const uint64_t SOLVE_CHUNK_SIZE = 1 << 20;  // Positions per compressed chunk
+const uint64_t SOLVE_SLICE_LIMIT = 1 << 24; // Most positions in one slice
+const char SOLVE_MAGIC[4] = { 'S', 'P', 'S', 'V' };
+
+// Solved tables needed while sweeping one slice
+struct SolveSlice {
+    std::string dir;
+    int maskA;
+    int maskB;
+    uint64_t key;         // Top digits of the partition index
+    uint64_t firstIndex;  // Partition index of values[0]
+    std::vector<unsigned char> values;
+    std::map<std::pair<int, uint64_t>, std::vector<unsigned char>> loaded;  // Finished slices read so far
+    std::pair<int, uint64_t> lastId;                // Most recent entry of loaded, to skip the map lookup
+    const std::vector<unsigned char>* lastTable;
+    bool failed;
+    std::string failedPath;  // Dependency that could not be read
+};
+
+std::mutex solveLogMutex;
+
+int countTokensHome(int mask) {
+    int count = 0;
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        if (mask & (1 << i)) count++;
+    }
+    return count;
+}
+
+uint64_t powerOfDigits(int digits) {
+    uint64_t size = 1;
+    for (int i = 0; i < digits; i++) {
+        size *= BOARD_SIZE + 1;
+    }
+    return size;
+}
+
+// Number of low digits inside one slice. Capped at two fewer than the tokens on
+// the board so even the partition with no tokens home splits into many slices.
+int computeSliceDigits() {
+    int digits = 0;
+    while (digits < 2 * MAX_TOKENS - 2 && powerOfDigits(digits + 1) <= SOLVE_SLICE_LIMIT) {
+        digits++;
+    }
+    return digits;
+}
+
+int sliceDigits() {
+    static const int digits = computeSliceDigits();
+    return digits;
+}
+
+int tokensLeft(int maskA, int maskB) {
+    return 2 * MAX_TOKENS - countTokensHome(maskA) - countTokensHome(maskB);
+}
+
+uint64_t partitionSize(int maskA, int maskB) {
+    return powerOfDigits(tokensLeft(maskA, maskB));
+}
+
+uint64_t sliceSize(int maskA, int maskB) {
+    return powerOfDigits(std::min(tokensLeft(maskA, maskB), sliceDigits()));
+}
+
+// Sum of the top digits naming a slice; successors never have a smaller sum
+int sliceDigitSum(uint64_t key) {
+    int sum = 0;
+    for (; key > 0; key /= BOARD_SIZE + 1) {
+        sum += key % (BOARD_SIZE + 1);
+    }
+    return sum;
+}
+
+std::string slicePath(const std::string& dir, int maskA, int maskB, uint64_t key) {
+    return dir + "/p_" + std::to_string(maskA) + "_" + std::to_string(maskB) + "_" + std::to_string(key) + ".bin";
+}
+
+// Build the position with the given index inside partition (maskA, maskB)
+void decodePosition(int maskA, int maskB, uint64_t index, GameState& state) {
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        state.playerA_tokens[i][0] = i + 1;
+        if (maskA & (1 << i)) {
+            state.playerA_tokens[i][1] = BOARD_SIZE + 1;
+        }
+        else {
+            state.playerA_tokens[i][1] = index % (BOARD_SIZE + 1);
+            index /= BOARD_SIZE + 1;
+        }
+    }
+    for (int j = 0; j < MAX_TOKENS; j++) {
+        state.playerB_tokens[j][1] = j + 1;
+        if (maskB & (1 << j)) {
+            state.playerB_tokens[j][0] = BOARD_SIZE + 1;
+        }
+        else {
+            state.playerB_tokens[j][0] = index % (BOARD_SIZE + 1);
+            index /= BOARD_SIZE + 1;
+        }
+    }
+}
+
+// Inverse of decodePosition: find the partition and index of a position
+uint64_t encodePosition(const GameState& state, int* maskA, int* maskB) {
+    uint64_t index = 0;
+    uint64_t scale = 1;
+    *maskA = 0;
+    *maskB = 0;
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        if (state.playerA_tokens[i][1] > BOARD_SIZE) {
+            *maskA |= 1 << i;
+        }
+        else {
+            index += state.playerA_tokens[i][1] * scale;
+            scale *= BOARD_SIZE + 1;
+        }
+    }
+    for (int j = 0; j < MAX_TOKENS; j++) {
+        if (state.playerB_tokens[j][0] > BOARD_SIZE) {
+            *maskB |= 1 << j;
+        }
+        else {
+            index += state.playerB_tokens[j][0] * scale;
+            scale *= BOARD_SIZE + 1;
+        }
+    }
+    return index;
+}
+
+// A tokens keep their row and B tokens keep their column, so only an A token
+// and a B token can ever share a cell
+bool isValidPosition(const GameState& state) {
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        for (int j = 0; j < MAX_TOKENS; j++) {
+            if (state.playerA_tokens[i][0] == state.playerB_tokens[j][0] &&
+                state.playerA_tokens[i][1] == state.playerB_tokens[j][1]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// File header: magic, board size, masks, slice key and position count
+struct SliceHeader {
+    char magic[4];
+    int32_t boardSize;
+    int32_t maskA;
+    int32_t maskB;
+    uint64_t key;
+    uint64_t total;
+};
+
+SliceHeader makeSliceHeader(int maskA, int maskB, uint64_t key) {
+    SliceHeader header;
+    std::copy(SOLVE_MAGIC, SOLVE_MAGIC + 4, header.magic);
+    header.boardSize = BOARD_SIZE;
+    header.maskA = maskA;
+    header.maskB = maskB;
+    header.key = key;
+    header.total = sliceSize(maskA, maskB);
+    return header;
+}
+
+// Read and check a slice header against the current board
+bool readSliceHeader(std::ifstream& in, int maskA, int maskB, uint64_t key) {
+    SliceHeader expected = makeSliceHeader(maskA, maskB, key);
+    SliceHeader header;
+    in.read(header.magic, sizeof(header.magic));
+    in.read(reinterpret_cast<char*>(&header.boardSize), sizeof(header.boardSize));
+    in.read(reinterpret_cast<char*>(&header.maskA), sizeof(header.maskA));
+    in.read(reinterpret_cast<char*>(&header.maskB), sizeof(header.maskB));
+    in.read(reinterpret_cast<char*>(&header.key), sizeof(header.key));
+    in.read(reinterpret_cast<char*>(&header.total), sizeof(header.total));
+    return in && std::equal(header.magic, header.magic + 4, expected.magic) &&
+        header.boardSize == expected.boardSize && header.maskA == expected.maskA &&
+        header.maskB == expected.maskB && header.key == expected.key && header.total == expected.total;
+}
+
+
+// Flush a written file to disk so a crash after the rename can't leave it half written
+bool syncToDisk(const std::string& path) {
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+    if (fd == -1) return false;
+    bool synced = _commit(fd) == 0;
+    _close(fd);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+#endif
+    return synced;
+}
+
+bool writeSlice(const std::string& dir, int maskA, int maskB, uint64_t key, const std::vector<unsigned char>& values) {
+    // Write to a temporary file first so a crash never leaves a partial slice behind
+    std::string path = slicePath(dir, maskA, maskB, key);
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+
+    SliceHeader header = makeSliceHeader(maskA, maskB, key);
+    out.write(header.magic, sizeof(header.magic));
+    out.write(reinterpret_cast<const char*>(&header.boardSize), sizeof(header.boardSize));
+    out.write(reinterpret_cast<const char*>(&header.maskA), sizeof(header.maskA));
+    out.write(reinterpret_cast<const char*>(&header.maskB), sizeof(header.maskB));
+    out.write(reinterpret_cast<const char*>(&header.key), sizeof(header.key));
+    out.write(reinterpret_cast<const char*>(&header.total), sizeof(header.total));
+
+    uint64_t total = values.size();
+    std::vector<unsigned char> packed(compressBound(SOLVE_CHUNK_SIZE));
+    for (uint64_t offset = 0; offset < total; offset += SOLVE_CHUNK_SIZE) {
+        uLong rawLength = static_cast<uLong>(std::min(SOLVE_CHUNK_SIZE, total - offset));
+        uLongf packedLength = static_cast<uLongf>(packed.size());
+        if (compress2(packed.data(), &packedLength, values.data() + offset, rawLength, Z_BEST_SPEED) != Z_OK) {
+            return false;
+        }
+
+        uint32_t chunk[2] = { static_cast<uint32_t>(rawLength), static_cast<uint32_t>(packedLength) };
+        out.write(reinterpret_cast<const char*>(chunk), sizeof(chunk));
+        out.write(reinterpret_cast<const char*>(packed.data()), packedLength);
+    }
+
+    out.close();
+    if (!out || !syncToDisk(tmpPath)) return false;
+
+    std::error_code error;
+    std::filesystem::rename(tmpPath, path, error);
+    if (error) return false;
+
+#ifndef _WIN32
+    // Make the rename itself survive a crash
+    syncToDisk(dir);
+#endif
+    return true;
+}
+
+bool readSlice(const std::string& dir, int maskA, int maskB, uint64_t key, std::vector<unsigned char>& values) {
+    std::ifstream in(slicePath(dir, maskA, maskB, key), std::ios::binary);
+    if (!in || !readSliceHeader(in, maskA, maskB, key)) return false;
+
+    uint64_t total = sliceSize(maskA, maskB);
+    values.assign(total, SOLVE_INVALID);
+    std::vector<unsigned char> packed(compressBound(SOLVE_CHUNK_SIZE));
+    for (uint64_t offset = 0; offset < total; offset += SOLVE_CHUNK_SIZE) {
+        uint32_t chunk[2];
+        in.read(reinterpret_cast<char*>(chunk), sizeof(chunk));
+        if (!in || chunk[0] != std::min(SOLVE_CHUNK_SIZE, total - offset) || chunk[1] > packed.size()) {
+            return false;
+        }
+
+        in.read(reinterpret_cast<char*>(packed.data()), chunk[1]);
+        uLongf rawLength = chunk[0];
+        if (!in || uncompress(values.data() + offset, &rawLength, packed.data(), chunk[1]) != Z_OK ||
+            rawLength != chunk[0]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A slice counts as finished only if its whole file belongs to this board and decompresses
+bool isSliceSolved(const std::string& dir, int maskA, int maskB, uint64_t key) {
+    std::vector<unsigned char> values;
+    return readSlice(dir, maskA, maskB, key, values);
+}
+
+// Look up an already solved successor position with its player to move
+unsigned char lookupSolved(SolveSlice& slice, const GameState& state) {
+    int maskA, maskB;
+    uint64_t index = encodePosition(state, &maskA, &maskB);
+    uint64_t size = sliceSize(maskA, maskB);
+    uint64_t key = index / size;
+
+    const std::vector<unsigned char>* table = &slice.values;
+    if (maskA != slice.maskA || maskB != slice.maskB || key != slice.key) {
+        std::pair<int, uint64_t> id((maskA << MAX_TOKENS) | maskB, key);
+        if (slice.lastTable != NULL && slice.lastId == id) {
+            unsigned char value = (*slice.lastTable)[index - key * size];
+            return (state.currentPlayer == 'A') ? (value & 3) : (value >> 2);
+        }
+
+        std::map<std::pair<int, uint64_t>, std::vector<unsigned char>>::iterator it = slice.loaded.find(id);
+        if (it == slice.loaded.end()) {
+            it = slice.loaded.insert(std::make_pair(id, std::vector<unsigned char>())).first;
+            if (!readSlice(slice.dir, maskA, maskB, key, it->second)) {
+                // The sweep stops at the next position and the slice is not written
+                slice.failed = true;
+                slice.failedPath = slicePath(slice.dir, maskA, maskB, key);
+                slice.loaded.erase(it);
+                return SOLVE_DRAW;
+            }
+        }
+        table = &it->second;
+        slice.lastId = id;
+        slice.lastTable = table;
+    }
+
+    unsigned char value = (*table)[index - key * size];
+    return (state.currentPlayer == 'A') ? (value & 3) : (value >> 2);
+}
+
+// Solve one side to move; sets *canMove to false if that side has to pass
+unsigned char solveSide(SolveSlice& slice, GameState state, char player, bool* canMove) {
+    int moves[MAX_TOKENS * 2][4];
+    int moveCount = 0;
+    state.currentPlayer = player;
+    getAllPossibleMoves(state, moves, &moveCount);
+
+    *canMove = moveCount > 0;
+    unsigned char win = (player == 'A') ? SOLVE_A_WINS : SOLVE_B_WINS;
+    unsigned char best = (player == 'A') ? SOLVE_B_WINS : SOLVE_A_WINS;
+
+    for (int i = 0; i < moveCount; i++) {
+        GameState next = state;
+        applyMove(next, moves[i]);
+        next.currentPlayer = getOpponent(player);
+
+        unsigned char result = lookupSolved(slice, next);
+        if (slice.failed) return SOLVE_DRAW;
+        if (result == win) return win;
+        if (result == SOLVE_DRAW) best = SOLVE_DRAW;
+    }
+    return best;
+}
+
+bool solveSlice(const std::string& dir, int maskA, int maskB, uint64_t key) {
+    const int fullMask = (1 << MAX_TOKENS) - 1;
+    SolveSlice slice;
+    slice.dir = dir;
+    slice.maskA = maskA;
+    slice.maskB = maskB;
+    slice.key = key;
+    slice.failed = false;
+    slice.lastTable = NULL;
+
+    uint64_t size = sliceSize(maskA, maskB);
+    slice.firstIndex = key * size;
+    slice.values.assign(size, SOLVE_INVALID);
+
+    if (maskA == fullMask || maskB == fullMask) {
+        // Game already over: tokens home can't block anyone, so every position is valid
+        unsigned char winner = (maskA == fullMask) ? SOLVE_A_WINS : SOLVE_B_WINS;
+        std::fill(slice.values.begin(), slice.values.end(), winner | (winner << 2));
+    }
+    else {
+        GameState state;
+        for (uint64_t offset = size; offset-- > 0; ) {
+            decodePosition(maskA, maskB, slice.firstIndex + offset, state);
+            if (!isValidPosition(state)) continue;
+
+            bool canMoveA, canMoveB;
+            unsigned char resultA = solveSide(slice, state, 'A', &canMoveA);
+            unsigned char resultB = solveSide(slice, state, 'B', &canMoveB);
+            if (slice.failed) break;
+
+            // A player without moves passes the turn, the position stays the same
+            if (!canMoveA && !canMoveB) {
+                resultA = SOLVE_DRAW;
+                resultB = SOLVE_DRAW;
+            }
+            else if (!canMoveA) {
+                resultA = resultB;
+            }
+            else if (!canMoveB) {
+                resultB = resultA;
+            }
+            slice.values[offset] = resultA | (resultB << 2);
+        }
+    }
+
+    if (slice.failed) {
+        std::lock_guard<std::mutex> lock(solveLogMutex);
+        std::cerr << "Error: could not read " << slice.failedPath << " needed by "
+            << slicePath(dir, maskA, maskB, key) << "; delete it and rerun to solve it again\n";
+        return false;
+    }
+    if (!writeSlice(dir, maskA, maskB, key, slice.values)) {
+        std::lock_guard<std::mutex> lock(solveLogMutex);
+        std::cerr << "Error: could not write slice " << maskA << "_" << maskB << "_" << key << "\n";
+        return false;
+    }
+    return true;
+}
+
+// One unit of work for the solver threads
+struct SolveJob {
+    int maskA;
+    int maskB;
+    uint64_t key;
+};
+
+bool runSolver(const std::string& dir, int threadCount) {
+    const int fullMask = (1 << MAX_TOKENS) - 1;
+    if (threadCount < 1) threadCount = 1;
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+        std::cerr << "Error: could not create directory " << dir << "\n";
+        return false;
+    }
+
+    std::cout << "Solving " << BOARD_SIZE << "x" << BOARD_SIZE << " board into " << dir
+        << " with " << threadCount << " threads, slices of up to " << powerOfDigits(sliceDigits())
+        << " positions\n";
+
+    // Level = number of tokens already home; each level only depends on the ones above it.
+    // Inside a level, a wave holds the slices whose top digits add up to the same sum.
+    for (int level = 2 * MAX_TOKENS; level >= 0; level--) {
+        int topDigits = 2 * MAX_TOKENS - level - std::min(2 * MAX_TOKENS - level, sliceDigits());
+
+        for (int digitSum = topDigits * BOARD_SIZE; digitSum >= 0; digitSum--) {
+            std::vector<SolveJob> pending;
+            for (int maskA = 0; maskA <= fullMask; maskA++) {
+                for (int maskB = 0; maskB <= fullMask; maskB++) {
+                    if (countTokensHome(maskA) + countTokensHome(maskB) != level) continue;
+
+                    uint64_t sliceCount = partitionSize(maskA, maskB) / sliceSize(maskA, maskB);
+                    for (uint64_t key = 0; key < sliceCount; key++) {
+                        if (sliceDigitSum(key) == digitSum && !isSliceSolved(dir, maskA, maskB, key)) {
+                            SolveJob job = { maskA, maskB, key };
+                            pending.push_back(job);
+                        }
+                    }
+                }
+            }
+            if (pending.empty()) continue;
+
+            std::atomic<size_t> next(0);
+            std::atomic<bool> failed(false);
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threadCount; t++) {
+                workers.emplace_back([&]() {
+                    size_t k;
+                    while (!failed && (k = next++) < pending.size()) {
+                        if (!solveSlice(dir, pending[k].maskA, pending[k].maskB, pending[k].key)) failed = true;
+                    }
+                });
+            }
+            for (size_t t = 0; t < workers.size(); t++) {
+                workers[t].join();
+            }
+            if (failed) return false;
+
+            std::cout << "Solved " << pending.size() << " slices with " << level
+                << " tokens home, top digit sum " << digitSum << "\n";
+        }
+    }
+
+    // Report the result for the starting position
+    initializeGame();
+    int maskA, maskB;
+    uint64_t index = encodePosition(currentState, &maskA, &maskB);
+    uint64_t size = sliceSize(maskA, maskB);
+    std::vector<unsigned char> values;
+    if (!readSlice(dir, maskA, maskB, index / size, values)) return false;
+
+    const char* names[] = { "invalid", "Player A wins", "Player B wins", "draw" };
+    std::cout << "Starting position (A to move): " << names[values[index % size] & 3] << "\n";
+    return true;
+}
+
+
+// ---------------------------------------------------------------------------
+// Multi-PV analysis
+//
+// A background thread searches every root move with its own full window, so
+// each move gets an exact score and principal variation, and deepens all of
+// them one ply at a time. Each root move is published as soon as it finishes,
+// and the GUI copies the small result table once per frame, so the overlay
+// updates while the search keeps running. Scores are from the point of view
+// of the player to move: WIN_SCORE - plies for a forced win, the negative for
+// a forced loss, otherwise the difference in steps the tokens still have to go.
+// ---------------------------------------------------------------------------
+
+std::mutex analysisMutex;
+MoveAnalysis analysisMoves[MAX_ROOT_MOVES];
+int analysisMoveCount = 0;
+int analysisDepth = 0;           // Last depth finished for all root moves
+bool analysisComplete = false;   // Search reached the end of every line
+GameState analysisState;         // Position being analysed
+bool analysisRunning = false;    // analysisState holds a started analysis
+std::thread analysisThread;
+std::atomic<bool> analysisStop(false);
+
+bool sameState(const GameState& a, const GameState& b) {
+    if (a.currentPlayer != b.currentPlayer) return false;
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        if (a.playerA_tokens[i][0] != b.playerA_tokens[i][0] || a.playerA_tokens[i][1] != b.playerA_tokens[i][1]) return false;
+        if (a.playerB_tokens[i][0] != b.playerB_tokens[i][0] || a.playerB_tokens[i][1] != b.playerB_tokens[i][1]) return false;
+    }
+    return true;
+}
+
+// Heuristic for positions at the search horizon
+int evaluatePosition(const GameState& state) {
+    // Fewer steps left to the goal edge than the opponent is good
+    int stepsA = 0, stepsB = 0;
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        stepsA += BOARD_SIZE + 1 - state.playerA_tokens[i][1];
+        stepsB += BOARD_SIZE + 1 - state.playerB_tokens[i][0];
+    }
+    int score = stepsB - stepsA;
+    return (state.currentPlayer == 'A') ? score : -score;
+}
+
+// Negamax with alpha-beta; *hitHorizon is set when a line was cut off by depth
+int analysisSearch(GameState& state, int depth, int ply, int alpha, int beta,
+    int pv[][4], int* pvLength, bool* hitHorizon, bool passed) {
+    *pvLength = 0;
+    char player = state.currentPlayer;
+    if (hasWon(state, player)) return WIN_SCORE - ply;
+    if (hasWon(state, getOpponent(player))) return -(WIN_SCORE - ply);
+
+    if (depth == 0 || ply >= MAX_ANALYSIS_DEPTH - 1) {
+        *hitHorizon = true;
+        return evaluatePosition(state);
+    }
+
+    int moves[MAX_ROOT_MOVES][4];
+    int moveCount = 0;
+    getAllPossibleMoves(state, moves, &moveCount);
+
+    int childPv[MAX_ANALYSIS_DEPTH][4];
+    int childLength = 0;
+
+    if (moveCount == 0) {
+        // Neither player can move: nobody will ever win
+        if (passed) return 0;
+
+        // Turn passes to the opponent in the same position
+        state.currentPlayer = getOpponent(player);
+        int score = -analysisSearch(state, depth - 1, ply + 1, -beta, -alpha, childPv, &childLength, hitHorizon, true);
+        state.currentPlayer = player;
+
+        for (int k = 0; k < 4; k++) pv[0][k] = -1;
+        for (int m = 0; m < childLength; m++) {
+            for (int k = 0; k < 4; k++) pv[m + 1][k] = childPv[m][k];
+        }
+        *pvLength = childLength + 1;
+        return score;
+    }
+
+    for (int i = 0; i < moveCount; i++) {
+        GameState next = state;
+        applyMove(next, moves[i]);
+        next.currentPlayer = getOpponent(player);
+
+        int score = -analysisSearch(next, depth - 1, ply + 1, -beta, -alpha, childPv, &childLength, hitHorizon, false);
+        if (analysisStop) return 0;
+
+        if (score > alpha) {
+            alpha = score;
+            for (int k = 0; k < 4; k++) pv[0][k] = moves[i][k];
+            for (int m = 0; m < childLength; m++) {
+                for (int k = 0; k < 4; k++) pv[m + 1][k] = childPv[m][k];
+            }
+            *pvLength = childLength + 1;
+        }
+        if (alpha >= beta) break;
+    }
+    return alpha;
+}
+
+void analysisWorker(GameState root) {
+    int moves[MAX_ROOT_MOVES][4];
+    int moveCount = 0;
+    getAllPossibleMoves(root, moves, &moveCount);
+
+    for (int depth = 1; depth < MAX_ANALYSIS_DEPTH; depth++) {
+        bool hitHorizon = false;
+
+        for (int i = 0; i < moveCount; i++) {
+            GameState next = root;
+            applyMove(next, moves[i]);
+            next.currentPlayer = getOpponent(root.currentPlayer);
+
+            // Full window for every root move so each one gets an exact score
+            int pv[MAX_ANALYSIS_DEPTH][4];
+            int pvLength = 0;
+            int score = -analysisSearch(next, depth - 1, 1, -WIN_SCORE - 1, WIN_SCORE + 1, pv, &pvLength, &hitHorizon, false);
+            if (analysisStop) return;
+
+            std::lock_guard<std::mutex> lock(analysisMutex);
+            MoveAnalysis& entry = analysisMoves[i];
+            entry.score = score;
+            entry.depth = depth;
+            for (int m = 0; m < pvLength && m + 1 < MAX_ANALYSIS_DEPTH; m++) {
+                for (int k = 0; k < 4; k++) entry.pv[m + 1][k] = pv[m][k];
+            }
+            entry.pvLength = std::min(pvLength + 1, MAX_ANALYSIS_DEPTH);
+        }
+
+        std::lock_guard<std::mutex> lock(analysisMutex);
+        analysisDepth = depth;
+        if (!hitHorizon) {
+            // Every line reached the end of the game, deeper searches change nothing
+            analysisComplete = true;
+            return;
+        }
+    }
+}
+
+void stopAnalysis() {
+    analysisStop = true;
+    if (analysisThread.joinable()) {
+        analysisThread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(analysisMutex);
+    analysisRunning = false;
+}
+
+void startAnalysis(const GameState& state) {
+    stopAnalysis();
+
+    {
+        std::lock_guard<std::mutex> lock(analysisMutex);
+        analysisState = state;
+        int moves[MAX_ROOT_MOVES][4];
+        getAllPossibleMoves(state, moves, &analysisMoveCount);
+        for (int i = 0; i < analysisMoveCount; i++) {
+            MoveAnalysis& entry = analysisMoves[i];
+            for (int k = 0; k < 4; k++) {
+                entry.move[k] = moves[i][k];
+                entry.pv[0][k] = moves[i][k];
+            }
+            entry.score = 0;
+            entry.depth = 0;
+            entry.pvLength = 1;
+        }
+        analysisDepth = 0;
+        analysisComplete = false;
+        analysisRunning = true;
+    }
+
+    analysisStop = false;
+    analysisThread = std::thread(analysisWorker, state);
+}
+
+// Restart the search only when the position differs from the one being analysed
+void updateAnalysis(const GameState& state) {
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(analysisMutex);
+        changed = !analysisRunning || !sameState(analysisState, state);
+    }
+    if (changed) {
+        startAnalysis(state);
+    }
+}
+
+// Copy the latest results; returns the number of root moves
+int getAnalysisSnapshot(MoveAnalysis entries[], int* depth, bool* complete) {
+    std::lock_guard<std::mutex> lock(analysisMutex);
+    for (int i = 0; i < analysisMoveCount; i++) {
+        entries[i] = analysisMoves[i];
+    }
+    *depth = analysisDepth;
+    *complete = analysisComplete;
+    return analysisMoveCount;
+}
+
+// "W5" = forced win in 5 plies, "L4" = forced loss in 4 plies, otherwise the heuristic
+std::string formatScore(int score) {
+    if (score > WIN_SCORE - MAX_ANALYSIS_DEPTH) return "W" + std::to_string(WIN_SCORE - score);
+    if (score < -(WIN_SCORE - MAX_ANALYSIS_DEPTH)) return "L" + std::to_string(WIN_SCORE + score);
+    return (score > 0 ? "+" : "") + std::to_string(score);
+}
+
+// ---------------------------------------------------------------------------
+// Opening book
+//
+// Every game starts from the same position, so the best replies for the first
+// plies are computed once offline (GameLogic --build-book) with the analysis
+// search run until every line reaches the end of the game. The book file is a
+// sorted array of (position hash, move) records that findBestMove looks up
+// with a binary search before it searches on its own.
+// ---------------------------------------------------------------------------
+
+const char BOOK_MAGIC[4] = { 'S', 'P', 'B', 'K' };
+const int BOOK_RECORD_SIZE = 12;  // 8 byte hash + 4 byte move
+
+struct BookEntry {
+    uint64_t hash;
+    unsigned char move[4];
+};
+
+std::vector<BookEntry> openingBook;
+int bookProbes = 0;
+int bookHits = 0;
+
+// FNV-1a over the token coordinates and the player to move
+uint64_t hashPosition(const GameState& state) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < MAX_TOKENS; i++) {
+        int values[4] = { state.playerA_tokens[i][0], state.playerA_tokens[i][1],
+            state.playerB_tokens[i][0], state.playerB_tokens[i][1] };
+        for (int k = 0; k < 4; k++) {
+            hash = (hash ^ static_cast<unsigned char>(values[k])) * 1099511628211ULL;
+        }
+    }
+    return (hash ^ static_cast<unsigned char>(state.currentPlayer)) * 1099511628211ULL;
+}
+
+bool compareBookEntries(const BookEntry& a, const BookEntry& b) {
+    return a.hash < b.hash;
+}
+
+// Best move by iterative deepening until no line is cut off by the horizon
+bool searchBookMove(GameState state, BookEntry& entry) {
+    int pv[MAX_ANALYSIS_DEPTH][4];
+    int pvLength = 0;
+    for (int depth = 1; depth < MAX_ANALYSIS_DEPTH; depth++) {
+        bool hitHorizon = false;
+        analysisSearch(state, depth, 0, -WIN_SCORE - 1, WIN_SCORE + 1, pv, &pvLength, &hitHorizon, false);
+        if (!hitHorizon) break;
+    }
+    if (pvLength == 0 || pv[0][0] == -1) return false;
+
+    entry.hash = hashPosition(state);
+    for (int k = 0; k < 4; k++) {
+        entry.move[k] = static_cast<unsigned char>(pv[0][k]);
+    }
+    return true;
+}
+
+bool buildBook(const std::string& path, int plies, int threadCount) {
+    if (threadCount < 1) threadCount = 1;
+
+    // Breadth-first so every position is first met at its shallowest ply
+    initializeGame();
+    std::vector<GameState> positions;
+    std::vector<GameState> level(1, currentState);
+    std::set<uint64_t> seen;
+    seen.insert(hashPosition(currentState));
+
+    for (int ply = 0; ply < plies && !level.empty(); ply++) {
+        std::vector<GameState> nextLevel;
+        for (size_t p = 0; p < level.size(); p++) {
+            const GameState& state = level[p];
+            if (hasWon(state, 'A') || hasWon(state, 'B')) continue;
+
+            int moves[MAX_TOKENS * 2][4];
+            int moveCount = 0;
+            getAllPossibleMoves(state, moves, &moveCount);
+
+            std::vector<GameState> children;
+            if (moveCount == 0) {
+                // Turn passes to the opponent in the same position
+                GameState next = state;
+                next.currentPlayer = getOpponent(state.currentPlayer);
+                children.push_back(next);
+            }
+            else {
+                // findBestMove only runs for the computer, so only its positions need a reply
+                if (state.currentPlayer == 'B') {
+                    positions.push_back(state);
+                }
+                for (int i = 0; i < moveCount; i++) {
+                    GameState next = state;
+                    applyMove(next, moves[i]);
+                    next.currentPlayer = getOpponent(state.currentPlayer);
+                    children.push_back(next);
+                }
+            }
+
+            for (size_t c = 0; c < children.size(); c++) {
+                if (seen.insert(hashPosition(children[c])).second) {
+                    nextLevel.push_back(children[c]);
+                }
+            }
+        }
+        level.swap(nextLevel);
+    }
+
+    std::cout << "Building opening book: " << positions.size() << " computer positions in the first "
+        << plies << " plies, " << threadCount << " threads\n";
+
+    // Positions are independent, so workers just take the next one
+    std::vector<BookEntry> entries(positions.size());
+    std::vector<char> found(positions.size(), 0);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threadCount; t++) {
+        workers.emplace_back([&]() {
+            size_t k;
+            while ((k = next++) < positions.size()) {
+                found[k] = searchBookMove(positions[k], entries[k]);
+            }
+        });
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    std::vector<BookEntry> book;
+    for (size_t k = 0; k < entries.size(); k++) {
+        if (found[k]) book.push_back(entries[k]);
+    }
+    std::sort(book.begin(), book.end(), compareBookEntries);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Error: could not write opening book " << path << "\n";
+        return false;
+    }
+
+    int32_t boardSize = BOARD_SIZE;
+    uint64_t count = book.size();
+    out.write(BOOK_MAGIC, sizeof(BOOK_MAGIC));
+    out.write(reinterpret_cast<const char*>(&boardSize), sizeof(boardSize));
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (size_t k = 0; k < book.size(); k++) {
+        out.write(reinterpret_cast<const char*>(&book[k].hash), sizeof(book[k].hash));
+        out.write(reinterpret_cast<const char*>(book[k].move), sizeof(book[k].move));
+    }
+
+    out.close();
+    if (!out) {
+        std::cerr << "Error: could not write opening book " << path << "\n";
+        return false;
+    }
+
+    std::cout << "Wrote " << book.size() << " book moves (" << book.size() * BOOK_RECORD_SIZE
+        << " bytes) to " << path << "\n";
+    return true;
+}
+
+bool loadBook(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+
+    char magic[4];
+    int32_t boardSize = 0;
+    uint64_t count = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&boardSize), sizeof(boardSize));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || !std::equal(magic, magic + 4, BOOK_MAGIC) || boardSize != BOARD_SIZE) {
+        std::cerr << "Warning: ignoring opening book " << path << " (wrong format or board size)\n";
+        return false;
+    }
+
+    // The record count must match the file size before anything is allocated
+    std::error_code error;
+    uint64_t fileSize = std::filesystem::file_size(path, error);
+    uint64_t headerSize = sizeof(BOOK_MAGIC) + sizeof(boardSize) + sizeof(count);
+    if (error || fileSize < headerSize || (fileSize - headerSize) / BOOK_RECORD_SIZE != count ||
+        (fileSize - headerSize) % BOOK_RECORD_SIZE != 0) {
+        std::cerr << "Warning: ignoring opening book " << path << " (size does not match its record count)\n";
+        return false;
+    }
+
+    std::vector<BookEntry> book(count);
+    for (uint64_t k = 0; k < count; k++) {
+        in.read(reinterpret_cast<char*>(&book[k].hash), sizeof(book[k].hash));
+        in.read(reinterpret_cast<char*>(book[k].move), sizeof(book[k].move));
+    }
+    if (!in) {
+        std::cerr << "Warning: opening book " << path << " is truncated\n";
+        return false;
+    }
+
+    // probeBook binary searches the records, so they must be sorted by hash
+    for (uint64_t k = 1; k < count; k++) {
+        if (book[k].hash < book[k - 1].hash) {
+            std::cerr << "Warning: ignoring opening book " << path << " (records are not sorted)\n";
+            return false;
+        }
+    }
+
+    openingBook.swap(book);
+    return true;
+}
+
+bool probeBook(const GameState& state, int move[4]) {
+    if (openingBook.empty()) return false;
+    bookProbes++;
+
+    BookEntry key;
+    key.hash = hashPosition(state);
+    std::vector<BookEntry>::const_iterator it =
+        std::lower_bound(openingBook.begin(), openingBook.end(), key, compareBookEntries);
+    if (it == openingBook.end() || it->hash != key.hash) return false;
+
+    // Only trust the book move if it is legal here (guards against hash collisions)
+    int moves[MAX_TOKENS * 2][4];
+    int moveCount = 0;
+    getAllPossibleMoves(state, moves, &moveCount);
+    for (int i = 0; i < moveCount; i++) {
+        if (moves[i][0] == it->move[0] && moves[i][1] == it->move[1] &&
+            moves[i][2] == it->move[2] && moves[i][3] == it->move[3]) {
+            for (int k = 0; k < 4; k++) move[k] = moves[i][k];
+            bookHits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void printBookHitRate() {
+    if (bookProbes == 0) return;
+    std::cout << "Opening book hit rate: " << bookHits << "/" << bookProbes
+        << " (" << (100 * bookHits / bookProbes) << "%)\n";
 }
\ No newline at end of file